@@ -18,20 +18,50 @@
 #define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <err.h>
 #include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "backlight.h"
 
+#define CALIBRATE_PROBES 64
+
+/* latency differences smaller than this factor are timing noise */
+#define LATENCY_MARGIN 2
+
+void (*backlight_write_hook)(const char *path) = NULL;
+
 inline double clamp(double v, double low, double high)
 {
     return (v > high) ? high : (v < low) ? low : v;
 }
 
+/* Both paths can be pointed at a fake tree for testing. secure_getenv
+ * keeps the setuid bset from honouring them. */
+static const char *backlight_root(void)
+{
+    const char *root = secure_getenv("BACKLIGHT_ROOT");
+    return root ? root : BACKLIGHT_ROOT;
+}
+
+static const char *backlight_cache(void)
+{
+    const char *cache = secure_getenv("BACKLIGHT_CACHE");
+    return cache ? cache : BACKLIGHT_CACHE;
+}
+
+static long elapsed_usec(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000L +
+        (end->tv_nsec - start->tv_nsec) / 1000L;
+}
+
 static int get(filepath_t path, long *value)
 {
     int fd = open(path, O_RDONLY);
@@ -57,7 +87,7 @@ static int get(filepath_t path, long *value)
 
 static int set(filepath_t path, long value)
 {
-    int fd = open(path, O_WRONLY);
+    int fd = open(path, O_WRONLY | O_TRUNC);
     if (fd < 0) {
         warn("failed to open to write to backlight %s", path);
         return -1;
@@ -69,55 +99,306 @@ static int set(filepath_t path, long value)
         err(EXIT_FAILURE, "failed to set backlight");
 
     close(fd);
+    if (backlight_write_hook)
+        backlight_write_hook(path);
     return 0;
 }
 
+static void load_calibration(struct backlight_t *b)
+{
+    char line[1024], name[NAME_MAX + 1];
+    long max, levels, latency;
+    FILE *fp = fopen(backlight_cache(), "r");
+
+    b->levels = b->latency = 0;
+    if (!fp)
+        return;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%255s %ld %ld %ld", name, &max, &levels, &latency) != 4)
+            continue;
+
+        /* a different max means the driver changed, recalibrate */
+        if (strcmp(name, b->name) == 0 && max == b->max) {
+            b->levels = levels;
+            b->latency = latency;
+            break;
+        }
+    }
+
+    fclose(fp);
+}
+
 int backlight_init(struct backlight_t *b, const char *device)
 {
     filepath_t path;
+    const char *root = backlight_root();
 
-    snprintf(path, PATH_MAX, BACKLIGHT_ROOT "/%s/max_brightness", device);
+    snprintf(path, PATH_MAX, "%s/%s/max_brightness", root, device);
     if (get(path, &b->max) < 0)
         return -1;
 
-    snprintf(b->dev, PATH_MAX, BACKLIGHT_ROOT "/%s/brightness", device);
+    snprintf(b->name, sizeof(b->name), "%s", device);
+    snprintf(b->dev, PATH_MAX, "%s/%s/brightness", root, device);
+
+    /* not every driver (or fake tree) has actual_brightness */
+    snprintf(b->actual, PATH_MAX, "%s/%s/actual_brightness", root, device);
+    if (access(b->actual, R_OK) < 0)
+        memcpy(b->actual, b->dev, sizeof(filepath_t));
+
+    if (get(b->dev, &b->level) < 0)
+        b->level = 0;
+
+    load_calibration(b);
     return 0;
 }
 
 int backlight_set(struct backlight_t *b, double value)
 {
-    value = clamp(value, 0.0, 100.0) / 100.0 * (double)b->max;
-    return set(b->dev, (int)(value + 0.5));
+    long level = (long)(clamp(value, 0.0, 100.0) / 100.0 * (double)b->max + 0.5);
+
+    if (set(b->dev, level) < 0)
+        return -1;
+
+    b->level = level;
+    return 0;
 }
 
 double backlight_get(struct backlight_t *b)
 {
-    long value = 0;
-    int rc = get(b->dev, &value);
-    return rc ? rc : (double)value / (double)b->max * 100.0;
+    int rc = get(b->dev, &b->level);
+    return rc ? rc : backlight_cached(b);
+}
+
+double backlight_cached(const struct backlight_t *b)
+{
+    return (double)b->level / (double)b->max * 100.0;
+}
+
+/* Open actual_brightness for POLLPRI. The backlight class calls
+ * sysfs_notify on it whenever the brightness changes, regardless of who
+ * changed it. It has to be read once before poll will block. */
+int backlight_watch(struct backlight_t *b)
+{
+    char buf[64];
+    int fd = open(b->actual, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        warn("failed to open %s", b->actual);
+        return -1;
+    }
+
+    if (read(fd, buf, sizeof(buf)) < 0) {
+        warn("failed to read %s", b->actual);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Rearm the watch and check if someone else changed the brightness.
+ * This compares against brightness, not actual_brightness, since that's
+ * exactly what we wrote even if the hardware quantizes it. Returns 1 and
+ * the new level if it differs from the cache, which is left for the
+ * caller to update. */
+int backlight_sync(struct backlight_t *b, int fd, long *level)
+{
+    char buf[64];
+
+    if (fd >= 0 && (lseek(fd, 0, SEEK_SET) < 0 || read(fd, buf, sizeof(buf)) < 0))
+        warn("failed to rearm %s", b->actual);
+
+    if (get(b->dev, level) < 0 || *level == b->level)
+        return 0;
+
+    return 1;
+}
+
+/* The number of steps a fade can take in BACKLIGHT_FADE_USEC. Limited
+ * both by how many levels the panel can actually show and by how fast
+ * the interface accepts writes. */
+static long fade_steps(const struct backlight_t *b)
+{
+    long steps;
+
+    if (b->levels == 0)
+        return 1;
+
+    steps = BACKLIGHT_FADE_USEC / (b->latency > 0 ? b->latency : 1);
+    return b->levels < steps ? b->levels : steps;
+}
+
+int backlight_fade(struct backlight_t *b, double from, double to)
+{
+    long i, interval, steps = fade_steps(b);
+    struct timespec pause;
+
+    from = clamp(from, 0.0, 100.0);
+    to = clamp(to, 0.0, 100.0);
+
+    /* scale the number of steps to the distance we're travelling */
+    steps = (long)(steps * (from > to ? from - to : to - from) / 100.0 + 0.5);
+    if (steps <= 1)
+        return backlight_set(b, to);
+
+    /* pace the writes so the fade takes the same time on every device,
+     * the write itself already accounts for part of the interval */
+    interval = BACKLIGHT_FADE_USEC * (from > to ? from - to : to - from) / 100.0 / steps;
+    interval -= b->latency;
+    pause.tv_sec = 0;
+    pause.tv_nsec = interval > 0 ? interval * 1000L : 0;
+
+    for (i = 1; i <= steps; ++i) {
+        if (backlight_set(b, from + (to - from) * i / steps) < 0)
+            return -1;
+        if (i < steps && pause.tv_nsec)
+            nanosleep(&pause, NULL);
+    }
+
+    return 0;
+}
+
+/* Prefer calibrated devices, then the one that can fade in the most
+ * steps, then one that's clearly faster. Anything else, including
+ * uncalibrated devices, falls back to comparing max_brightness. */
+static bool is_better(const struct backlight_t *node, const struct backlight_t *best)
+{
+    long a, b;
+
+    if (best->max == 0)
+        return true;
+    if (!node->levels != !best->levels)
+        return node->levels != 0;
+    if (!node->levels)
+        return node->max > best->max;
+
+    a = fade_steps(node);
+    b = fade_steps(best);
+    if (a != b)
+        return a > b;
+
+    /* levels saturate at CALIBRATE_PROBES + 1, so this is common */
+    if (node->latency * LATENCY_MARGIN < best->latency)
+        return true;
+    if (best->latency * LATENCY_MARGIN < node->latency)
+        return false;
+    return node->max > best->max;
+}
+
+static DIR *open_root(void)
+{
+    DIR *dir = opendir(backlight_root());
+    if (dir == NULL)
+        err(EXIT_FAILURE, "failed to open directory");
+    return dir;
+}
+
+static bool is_device(const struct dirent *dp)
+{
+    if (dp->d_name[0] == '.')
+        return false;
+    return dp->d_type == DT_LNK || dp->d_type == DT_DIR;
 }
 
 int backlight_find_best(struct backlight_t *b)
 {
-    long biggest = 0;
     struct dirent *dp;
     struct backlight_t node;
-    DIR *dir = opendir(BACKLIGHT_ROOT);
+    DIR *dir = open_root();
 
-    if (dir == NULL)
-        err(EXIT_FAILURE, "failed to open directory");
+    b->max = 0;
+    while ((dp = readdir(dir))) {
+        if (!is_device(dp) || backlight_init(&node, dp->d_name) < 0)
+            continue;
+
+        if (node.max > 0 && is_better(&node, b))
+            *b = node;
+    }
+
+    closedir(dir);
+    return b->max > 0 ? 0 : -1;
+}
+
+/* Sweep the device through up to CALIBRATE_PROBES evenly spaced levels,
+ * timing each write and its read back and counting how many distinct
+ * values the hardware actually reports. The original brightness is
+ * restored afterwards. */
+int backlight_calibrate(struct backlight_t *b)
+{
+    long i, j, orig, total = 0;
+    long seen[CALIBRATE_PROBES + 1];
+    long probes = b->max < CALIBRATE_PROBES ? b->max : CALIBRATE_PROBES;
+
+    if (probes <= 0 || get(b->dev, &orig) < 0)
+        return -1;
+
+    b->levels = 0;
+    for (i = 0; i <= probes; ++i) {
+        struct timespec start, end;
+        long value, target = (b->max * i + probes / 2) / probes;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (set(b->dev, target) < 0 || get(b->actual, &value) < 0) {
+            set(b->dev, orig);
+            b->levels = 0;
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        total += elapsed_usec(&start, &end);
+
+        for (j = 0; j < b->levels; ++j) {
+            if (seen[j] == value)
+                break;
+        }
+        if (j == b->levels)
+            seen[b->levels++] = value;
+    }
+
+    b->latency = total / (probes + 1);
+    return set(b->dev, orig);
+}
+
+int backlight_calibrate_all(void)
+{
+    struct dirent *dp;
+    struct backlight_t node;
+    const char *cache = backlight_cache();
+    char dir_path[PATH_MAX], *slash;
+    DIR *dir = open_root();
+    FILE *fp;
+
+    snprintf(dir_path, PATH_MAX, "%s", cache);
+    slash = strrchr(dir_path, '/');
+    if (slash && slash != dir_path) {
+        *slash = '\0';
+        if (mkdir(dir_path, 0755) < 0 && errno != EEXIST)
+            warn("failed to create %s", dir_path);
+    }
+
+    fp = fopen(cache, "w");
+    if (!fp) {
+        warn("failed to open %s", cache);
+        closedir(dir);
+        return -1;
+    }
 
     while ((dp = readdir(dir))) {
-       if (dp->d_type & DT_LNK) {
-            backlight_init(&node, dp->d_name);
-            if (node.max > biggest) {
-                biggest = node.max;
-                *b = node;
-            }
+        if (!is_device(dp) || backlight_init(&node, dp->d_name) < 0)
+            continue;
+
+        if (backlight_calibrate(&node) < 0) {
+            warnx("failed to calibrate %s", node.name);
+            continue;
         }
+
+        printf("%s: %ld levels, %ldus per write, %ld fade steps\n",
+               node.name, node.levels, node.latency, fade_steps(&node));
+        fprintf(fp, "%s %ld %ld %ld\n", node.name, node.max, node.levels, node.latency);
     }
 
     closedir(dir);
+    fclose(fp);
     return 0;
 }
 
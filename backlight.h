@@ -21,19 +21,37 @@
 #include <limits.h>
 
 #define BACKLIGHT_ROOT "/sys/class/backlight"
+#define BACKLIGHT_CACHE "/var/cache/lightd/backlight"
+
+/* how long a full 0-100% fade should take */
+#define BACKLIGHT_FADE_USEC 250000L
 
 typedef char filepath_t[PATH_MAX];
 
 struct backlight_t {
     long max;
+    long levels;    /* distinct levels seen during calibration, 0 if unknown */
+    long latency;   /* write and read-back latency in usec */
+    long level;     /* last brightness written or observed */
+    char name[NAME_MAX + 1];
     filepath_t dev;
+    filepath_t actual;
 };
 
+/* called after every write to the backlight, lets tests inject delays */
+extern void (*backlight_write_hook)(const char *path);
+
 extern inline double clamp(double v, double low, double high);
 
 int backlight_init(struct backlight_t *b, const char *device);
 int backlight_set(struct backlight_t *b, double value);
 double backlight_get(struct backlight_t *b);
+double backlight_cached(const struct backlight_t *b);
+int backlight_watch(struct backlight_t *b);
+int backlight_sync(struct backlight_t *b, int fd, long *level);
+int backlight_fade(struct backlight_t *b, double from, double to);
 int backlight_find_best(struct backlight_t *light);
+int backlight_calibrate(struct backlight_t *b);
+int backlight_calibrate_all(void);
 
 #endif
@@ -30,6 +30,7 @@ enum action {
     ACTION_SET,
     ACTION_INC,
     ACTION_DEC,
+    ACTION_CALIBRATE,
     ACTION_INVALID
 };
 
@@ -40,7 +41,8 @@ static void __attribute__((__noreturn__)) usage(FILE *out)
         " -h, --help             display this help and exit\n"
         " -v, --version          display version\n"
         " -i, --inc              increment the backlight\n"
-        " -d, --dec              decrement the backlight\n", out);
+        " -d, --dec              decrement the backlight\n"
+        " -c, --calibrate        measure every backlight and cache the results\n", out);
 
     exit(out == stderr ? EXIT_FAILURE : EXIT_SUCCESS);
 }
@@ -58,11 +60,12 @@ int main(int argc, char *argv[])
         { "version", no_argument, 0, 'v' },
         { "inc",     no_argument, 0, 'i' },
         { "dec",     no_argument, 0, 'd' },
+        { "calibrate", no_argument, 0, 'c' },
         { 0, 0, 0, 0 }
     };
 
     while (true) {
-        int opt = getopt_long(argc, argv, "hvid", opts, NULL);
+        int opt = getopt_long(argc, argv, "hvidc", opts, NULL);
         if (opt == -1)
             break;
 
@@ -79,11 +82,22 @@ int main(int argc, char *argv[])
         case 'd':
             action = ACTION_DEC;
             break;
+        case 'c':
+            action = ACTION_CALIBRATE;
+            break;
         default:
             usage(stderr);
         }
     }
 
+    if (action == ACTION_CALIBRATE) {
+        if (backlight_calibrate_all() < 0)
+            errx(EXIT_FAILURE, "failed to calibrate backlights");
+        if (backlight_find_best(&b) == 0)
+            printf("using %s\n", b.name);
+        return 0;
+    }
+
     if (backlight_find_best(&b) < 0)
         errx(EXIT_FAILURE, "couldn't get backlight information");
     current = backlight_get(&b);
@@ -110,6 +124,7 @@ int main(int argc, char *argv[])
         return backlight_set(&b, current + value);
     case ACTION_DEC:
         return backlight_set(&b, current - value);
+    case ACTION_CALIBRATE:
     case ACTION_INVALID:
         break;
     }
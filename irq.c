@@ -0,0 +1,86 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Simon Gomizelj, 2013
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "irq.h"
+
+static bool is_named(char *actions, const char *const names[], size_t len)
+{
+    char *save = NULL, *token;
+    size_t i;
+
+    for (token = strtok_r(actions, " \t\n,", &save); token;
+         token = strtok_r(NULL, " \t\n,", &save)) {
+        for (i = 0; i < len; ++i) {
+            if (strcmp(token, names[i]) == 0)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/* Sum the interrupt counts, across all cpus, of every numbered irq with
+ * a field exactly matching one of names. Per-cpu summaries like NMI and
+ * LOC are skipped. */
+int irq_sample(const char *path, const char *const names[], size_t len,
+               unsigned long long *total)
+{
+    char *line = NULL;
+    size_t n = 0;
+    FILE *fp = fopen(path, "r");
+
+    if (!fp)
+        return -1;
+
+    *total = 0;
+    while (getline(&line, &n, fp) != -1) {
+        unsigned long long sum = 0;
+        char *p = line, *end;
+
+        while (isspace((unsigned char)*p))
+            ++p;
+        if (!isdigit((unsigned char)*p))
+            continue;
+
+        p = strchr(p, ':');
+        if (!p)
+            continue;
+
+        for (++p;; p = end) {
+            unsigned long long count = strtoull(p, &end, 10);
+            if (p == end)
+                break;
+            sum += count;
+        }
+
+        if (is_named(p, names, len))
+            *total += sum;
+    }
+
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+// vim: et:sts=4:sw=4:cino=(0
@@ -29,12 +29,24 @@
 #include <err.h>
 
 #include <libudev.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <linux/input.h>
 
 #include "backlight.h"
+#include "irq.h"
+
+#define IRQ_MAX 16
+#define ENERGY_SAMPLE_SEC 30
+#define ENERGY_BINS 10
+#define LIGHTD_SOCKET "/run/lightd.sock"
+#define LEASES_PER_UID 8
 
 enum power_state {
     AC_START = -1,
@@ -43,6 +55,11 @@ enum power_state {
     AC_BOTH
 };
 
+enum idle_backend {
+    IDLE_EVDEV,
+    IDLE_IRQ
+};
+
 struct power_state_t {
     int epoll_fd;
     int timer_fd;
@@ -58,6 +75,13 @@ struct fd_data_t {
     struct fd_data_t *prev;
 };
 
+struct lease_t {
+    int fd;
+    pid_t pid;
+    uid_t uid;
+    struct lease_t *next;
+};
+
 static enum power_state power_mode = AC_START;
 static struct power_state_t States[] = {
     [AC_ON] = {
@@ -71,17 +95,83 @@ static struct power_state_t States[] = {
 }, *state = NULL;
 
 static bool dimmer = false;
+static bool dimmed = false;
+static enum idle_backend backend = IDLE_EVDEV;
 static struct fd_data_t *head = NULL;
 static struct backlight_t b;
 
+static const char *irq_names[IRQ_MAX] = { "i8042" };
+static size_t irq_len = 0;
+static unsigned long long irq_count;
+
+static int signal_fd;
+static struct {
+    unsigned long wakeups;
+    unsigned long dims;
+    unsigned long irq_samples;
+} stats;
+
+/* A running model of how much power the backlight draws. Samples of
+ * battery power are regressed against brightness, and the time spent at
+ * each brightness is integrated separately, so the attributed energy is
+ * just the slope times those integrals. */
+static char *battery = NULL;
+static int energy_fd = -1;
+static struct {
+    struct timespec last;
+    double level_time;      /* brightness (%) integrated over seconds */
+    double saved_time;      /* brightness given up to dimming, likewise */
+    unsigned long n;
+    double sx, sy, sxx, sxy;
+    struct {
+        unsigned long n;
+        double power;
+    } bins[ENERGY_BINS];
+} energy;
+
 static struct udev *udev;
-static struct udev_monitor *power_mon, *input_mon;
-static int power_mon_fd, input_mon_fd;
+static struct udev_monitor *power_mon, *input_mon, *backlight_mon;
+static int power_mon_fd, input_mon_fd, backlight_mon_fd;
+static int backlight_fd = -1;
+
+/* parked while the lid is closed: no input watches, no timers and no
+ * writes to the backlight */
+static bool parked = false;
+static bool lid_closed = false;
+static int lid_fd = -1;
+static char *lid_devnode = NULL;
+
+/* dimming is inhibited while any client holds a connection open */
+static const char *socket_path = LIGHTD_SOCKET;
+static int inhibit_fd = -1;
+static struct lease_t *leases = NULL;
+
+static void timer_set(struct power_state_t *state);
+static void timer_disarm(struct power_state_t *state);
+static void energy_account(void);
+static void energy_arm(bool on);
+static void input_watch(void);
+static void input_release(void);
 
 static void backlight_dim(struct backlight_t *b, double dim)
 {
-    state->brightness = backlight_get(b);
-    backlight_set(b, clamp(state->brightness - dim, 1.5, 100));
+    energy_account();
+    dimmed = true;
+
+    state->brightness = backlight_cached(b);
+    backlight_fade(b, state->brightness, clamp(state->brightness - dim, 1.5, 100));
+    input_watch();
+}
+
+static void backlight_undim(struct backlight_t *b)
+{
+    if (!dimmed || parked)
+        return;
+
+    energy_account();
+    dimmed = false;
+    backlight_set(b, state->brightness);
+    input_release();
 }
 
 static void register_device(const char *devnode, int fd)
@@ -97,26 +187,46 @@ static void register_device(const char *devnode, int fd)
     head = node;
 }
 
+static void remove_device(struct fd_data_t *node)
+{
+    free(node->devnode);
+    close(node->fd);
+
+    if (node == head) {
+        head = node->next;
+        if (head)
+            head->prev = NULL;
+    } else {
+        node->prev->next = node->next;
+        if (node->next)
+            node->next->prev = node->prev;
+    }
+    free(node);
+}
+
 static void unregister_device(const char *devnode)
+{
+    struct fd_data_t *node, *next;
+
+    for (node = head; node; node = next) {
+        next = node->next;
+        if (strcmp(node->devnode, devnode) == 0)
+            remove_device(node);
+    }
+}
+
+/* the fd number can be reused, so it must leave the list when it's closed */
+static bool unregister_fd(int fd)
 {
     struct fd_data_t *node;
 
     for (node = head; node; node = node->next) {
-        if (strcmp(node->devnode, devnode) == 0) {
-            free(node->devnode);
-            close(node->fd);
-
-            if (node == head) {
-                head = node->next;
-                head->prev = NULL;
-            } else {
-                node->prev->next = node->next;
-                if (node->next)
-                    node->next->prev = node->prev;
-            }
-            free(node);
+        if (node->fd == fd) {
+            remove_device(node);
+            return true;
         }
     }
+    return false;
 }
 
 // {{{1 EPOLL
@@ -161,8 +271,10 @@ static int ev_open(const filepath_t devnode, const char **n)
     static char name[256];
 
     int fd = open(devnode, O_RDONLY);
-    if (fd < 0)
-        err(EXIT_FAILURE, "failed to open evdev device %s", devnode);
+    if (fd < 0) {
+        warn("failed to open evdev device %s", devnode);
+        return -1;
+    }
 
     rc = ioctl(fd, EVIOCGBIT(0, EV_MAX), evtype_bitmask);
     if (rc < 0)
@@ -188,6 +300,190 @@ cleanup:
 }
 // }}}
 
+// {{{1 IRQ
+static unsigned long long irq_read(void)
+{
+    const char *path = getenv("PROC_INTERRUPTS");
+    unsigned long long total;
+
+    if (!path)
+        path = PROC_INTERRUPTS;
+    if (irq_sample(path, irq_names, irq_len, &total) < 0)
+        err(EXIT_FAILURE, "failed to read %s", path);
+
+    ++stats.irq_samples;
+    return total;
+}
+
+/* Any change in the watched irq counts since the last sample means there
+ * was input activity. */
+static bool irq_activity(void)
+{
+    unsigned long long count = irq_read();
+    bool rc = count != irq_count;
+
+    irq_count = count;
+    return rc;
+}
+
+static void irq_init(void)
+{
+    size_t i;
+
+    /* default to the builtin list if none were given */
+    if (irq_len == 0)
+        while (irq_len < IRQ_MAX && irq_names[irq_len])
+            ++irq_len;
+
+    printf("Sampling interrupts for");
+    for (i = 0; i < irq_len; ++i)
+        printf(" %s", irq_names[i]);
+    printf("\n");
+    fflush(stdout);
+
+    irq_count = irq_read();
+}
+// }}}
+
+// {{{1 PARK
+static int lid_open(const char *devnode)
+{
+    uint8_t sw_bitmask[SW_MAX / 8 + 1] = { 0 };
+    int fd = open(devnode, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+        return -1;
+
+    if (ioctl(fd, EVIOCGBIT(EV_SW, sizeof(sw_bitmask)), sw_bitmask) < 0 ||
+        !(sw_bitmask[SW_LID / 8] & (1 << (SW_LID % 8)))) {
+        close(fd);
+        return -1;
+    }
+
+    memset(sw_bitmask, 0, sizeof(sw_bitmask));
+    if (ioctl(fd, EVIOCGSW(sizeof(sw_bitmask)), sw_bitmask) >= 0)
+        lid_closed = sw_bitmask[SW_LID / 8] & (1 << (SW_LID % 8));
+
+    return fd;
+}
+
+static void lid_close(void)
+{
+    close(lid_fd);
+    free(lid_devnode);
+    lid_fd = -1;
+    lid_devnode = NULL;
+    lid_closed = false;
+}
+
+static void park_update(void)
+{
+    bool next = lid_closed;
+    struct fd_data_t *node;
+    size_t i, len = sizeof(States) / sizeof(States[0]);
+
+    if (next == parked)
+        return;
+
+    energy_account();
+    parked = next;
+
+    if (parked) {
+        printf("Lid closed, parking...\n");
+
+        for (node = head; node; node = node->next) {
+            for (i = 0; i < len; ++i)
+                epoll_ctl(States[i].epoll_fd, EPOLL_CTL_DEL, node->fd, NULL);
+        }
+
+        for (i = 0; i < len; ++i)
+            timer_disarm(&States[i]);
+        energy_arm(false);
+    } else {
+        printf("Lid opened, resuming...\n");
+
+        for (node = head; node; node = node->next)
+            register_epoll(node->fd, power_mode);
+
+        /* forget whatever happened while parked */
+        if (backend == IDLE_IRQ)
+            irq_activity();
+
+        dimmed = false;
+        input_release();
+        backlight_set(&b, state->brightness);
+        timer_set(state);
+        energy_arm(power_mode == AC_OFF);
+    }
+
+    fflush(stdout);
+}
+
+static void lid_event(void)
+{
+    struct input_event ev;
+
+    while (read(lid_fd, &ev, sizeof(ev)) == sizeof(ev)) {
+        if (ev.type == EV_SW && ev.code == SW_LID)
+            lid_closed = ev.value;
+    }
+
+    park_update();
+}
+// }}}
+
+// {{{1 BACKLIGHT
+/* Someone else (bset, a hotkey, acpi_video) changed the brightness. Take
+ * it as the new preference and treat it like any other activity. */
+static void backlight_changed(void)
+{
+    long level;
+
+    if (backlight_sync(&b, backlight_fd, &level) <= 0)
+        return;
+
+    /* account the time before the change at the old level */
+    energy_account();
+    b.level = level;
+
+    /* firmware and desktops like to zero the backlight when the lid
+     * closes, that's not a preference to restore on opening it */
+    if (parked)
+        return;
+
+    state->brightness = backlight_cached(&b);
+    if (dimmed) {
+        dimmed = false;
+        input_release();
+    }
+    timer_set(state);
+}
+
+static void backlight_init_watch(void)
+{
+    struct epoll_event event = {
+        .events = EPOLLPRI
+    };
+    size_t i, len = sizeof(States) / sizeof(States[0]);
+
+    backlight_fd = backlight_watch(&b);
+    if (backlight_fd < 0)
+        return;
+
+    /* regular files (a fake tree) can't be polled, the uevents still work */
+    event.data.fd = backlight_fd;
+    for (i = 0; i < len; ++i) {
+        if (epoll_ctl(States[i].epoll_fd, EPOLL_CTL_ADD, backlight_fd, &event) < 0) {
+            if (errno != EPERM)
+                err(EXIT_FAILURE, "failed to add backlight to epoll");
+            close(backlight_fd);
+            backlight_fd = -1;
+            return;
+        }
+    }
+}
+// }}}
+
 // {{{1 UDEV
 static bool update_power_state(struct udev_device *dev, bool save)
 {
@@ -212,16 +508,31 @@ static bool update_power_state(struct udev_device *dev, bool save)
     fflush(stdout);
 
     if (next != power_mode) {
-        if (save)
-            state->brightness = backlight_get(&b);
+        energy_account();
+        energy_arm(next == AC_OFF && !parked);
+        if (save && !parked)
+            state->brightness = backlight_cached(&b);
         state = &States[next];
-        backlight_set(&b, state->brightness);
+        if (!parked)
+            backlight_set(&b, state->brightness);
     }
 
     power_mode = next;
     return true;
 }
 
+/* only batteries that report their power draw are any use to us */
+static bool is_battery(struct udev_device *dev)
+{
+    const char *type = udev_device_get_property_value(dev, "POWER_SUPPLY_TYPE");
+
+    if (!type || strcmp(type, "Battery") != 0)
+        return false;
+
+    return udev_device_get_sysattr_value(dev, "power_now") ||
+        udev_device_get_sysattr_value(dev, "current_now");
+}
+
 static void udev_init_power(void)
 {
     struct udev_list_entry *devices, *dev_list_entry;
@@ -235,11 +546,11 @@ static void udev_init_power(void)
         const char *path = udev_list_entry_get_name(dev_list_entry);
         struct udev_device *dev = udev_device_new_from_syspath(udev, path);
 
-        if (update_power_state(dev, false)) {
-            udev_device_unref(dev);
+        if (!state && update_power_state(dev, false))
             state = &States[power_mode];
-            break;
-        }
+
+        if (!battery && is_battery(dev))
+            battery = strdup(udev_device_get_syspath(dev));
 
         udev_device_unref(dev);
     }
@@ -273,7 +584,26 @@ static void udev_adddevice(struct udev_device *dev, bool enumerating)
         return;
 
     if (enumerating || strcmp("add", action) == 0) {
-        int fd = ev_open(devnode, &name);
+        int fd;
+
+        if (lid_fd < 0 && udev_device_get_property_value(dev, "ID_INPUT_SWITCH")) {
+            lid_fd = lid_open(devnode);
+            if (lid_fd >= 0) {
+                printf("Monitoring lid switch: %s\n", devnode);
+                fflush(stdout);
+
+                lid_devnode = strdup(devnode);
+                register_epoll(lid_fd, AC_BOTH);
+                park_update();
+                return;
+            }
+        }
+
+        /* the irq backend only needs evdev to catch activity while dimmed */
+        if (!dimmer || (backend == IDLE_IRQ && !dimmed))
+            return;
+
+        fd = ev_open(devnode, &name);
         if (fd < 0)
             return;
 
@@ -281,13 +611,19 @@ static void udev_adddevice(struct udev_device *dev, bool enumerating)
         fflush(stdout);
 
         register_device(devnode, fd);
-        register_epoll(fd, power_mode);
+        if (!parked)
+            register_epoll(fd, power_mode);
     } else if (strcmp("remove", action) == 0) {
-        unregister_device(devnode);
+        if (lid_devnode && strcmp(lid_devnode, devnode) == 0) {
+            lid_close();
+            park_update();
+        } else {
+            unregister_device(devnode);
+        }
     }
 }
 
-static void udev_init_input(void)
+static void udev_enumerate_input(void)
 {
     struct udev_list_entry *devices, *dev_list_entry;
     struct udev_enumerate *enumerate = udev_enumerate_new(udev);
@@ -306,6 +642,40 @@ static void udev_init_input(void)
     }
 
     udev_enumerate_unref(enumerate);
+}
+
+/* The irq backend can't see activity while dimmed, the counts are only
+ * sampled at the deadline. Rather than polling, watch evdev just long
+ * enough to catch the first event. */
+static void input_watch(void)
+{
+    if (backend == IDLE_IRQ)
+        udev_enumerate_input();
+}
+
+static void input_release(void)
+{
+    struct fd_data_t *node;
+
+    if (backend != IDLE_IRQ)
+        return;
+
+    while (head) {
+        node = head;
+        head = node->next;
+
+        close(node->fd);
+        free(node->devnode);
+        free(node);
+    }
+
+    /* forget the activity that woke us */
+    irq_count = irq_read();
+}
+
+static void udev_init_input(void)
+{
+    udev_enumerate_input();
 
     input_mon = udev_monitor_new_from_netlink(udev, "udev");
     udev_monitor_filter_add_match_subsystem_devtype(input_mon, "input", NULL);
@@ -349,6 +719,37 @@ static void udev_monitor_input(void)
     }
 }
 
+static void udev_init_backlight(void)
+{
+    backlight_mon = udev_monitor_new_from_netlink(udev, "udev");
+    udev_monitor_filter_add_match_subsystem_devtype(backlight_mon, "backlight", NULL);
+    udev_monitor_enable_receiving(backlight_mon);
+
+    backlight_mon_fd = udev_monitor_get_fd(backlight_mon);
+    register_epoll(backlight_mon_fd, AC_BOTH);
+}
+
+static void udev_monitor_backlight(void)
+{
+    bool changed = false;
+
+    while (true) {
+        struct udev_device *dev = udev_monitor_receive_device(backlight_mon);
+        if (!dev) {
+            if (errno == EAGAIN)
+                break;
+            err(EXIT_FAILURE, "failed to recieve backlight device");
+        }
+
+        if (strcmp(udev_device_get_sysname(dev), b.name) == 0)
+            changed = true;
+        udev_device_unref(dev);
+    }
+
+    if (changed)
+        backlight_changed();
+}
+
 static void udev_init(void)
 {
     udev = udev_new();
@@ -356,8 +757,8 @@ static void udev_init(void)
         err(EXIT_FAILURE, "can't create udev");
 
     udev_init_power();
-    if (dimmer)
-        udev_init_input();
+    udev_init_backlight();
+    udev_init_input();
 }
 // }}}
 
@@ -368,10 +769,34 @@ static void timer_set(struct power_state_t *state)
         .it_value = state->timeout,
     };
 
+    /* states that don't dim never got a timer */
+    if (!dimmer || !state->dim || parked || leases)
+        return;
+
     if (timerfd_settime(state->timer_fd, 0, &spec, NULL) < 0)
         err(EXIT_FAILURE, "failed to set timer");
 }
 
+static void timer_disarm(struct power_state_t *state)
+{
+    struct itimerspec spec = { .it_value.tv_sec = 0 };
+
+    if (!dimmer || !state->dim)
+        return;
+
+    if (timerfd_settime(state->timer_fd, 0, &spec, NULL) < 0)
+        err(EXIT_FAILURE, "failed to disarm timer");
+}
+
+/* a periodic timer won't retrigger under EPOLLET until read */
+static void timer_drain(int fd)
+{
+    uint64_t expired;
+
+    if (read(fd, &expired, sizeof(expired)) < 0 && errno != EAGAIN)
+        err(EXIT_FAILURE, "failed to read timer");
+}
+
 static void timer_state_init(struct power_state_t *state)
 {
     state->timer_fd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK);
@@ -399,12 +824,343 @@ static void timer_init(void)
 
     if (States[AC_OFF].dim)
         timer_state_init(&States[AC_OFF]);
+
+    if (backend == IDLE_IRQ)
+        irq_init();
+}
+// }}}
+
+// {{{1 INHIBIT
+static void inhibit_init(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct stat st;
+    mode_t mask;
+    int rc;
+
+    if (!dimmer)
+        return;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        errx(EXIT_FAILURE, "socket path too long: %s", socket_path);
+    strcpy(addr.sun_path, socket_path);
+
+    inhibit_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (inhibit_fd < 0)
+        err(EXIT_FAILURE, "failed to create socket");
+
+    /* only clear out a stale socket, never whatever else is there */
+    if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socket_path);
+
+    /* anyone may inhibit, create it 0666 rather than chmod by path */
+    mask = umask(0111);
+    rc = bind(inhibit_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+
+    /* not being able to inhibit shouldn't stop us dimming */
+    if (rc < 0 || listen(inhibit_fd, 16) < 0) {
+        warn("failed to listen on %s", socket_path);
+        close(inhibit_fd);
+        inhibit_fd = -1;
+        return;
+    }
+
+    register_epoll(inhibit_fd, AC_BOTH);
+}
+
+static size_t inhibit_count(uid_t uid)
+{
+    struct lease_t *lease;
+    size_t count = 0;
+
+    for (lease = leases; lease; lease = lease->next) {
+        if (lease->uid == uid)
+            ++count;
+    }
+    return count;
+}
+
+/* Anyone can connect, so cap the leases each user may hold. Running out
+ * of fds would otherwise let a client take down the daemon. */
+static bool inhibit_accept(int fd, struct ucred *cred)
+{
+    struct epoll_event event = {
+        .data.fd = fd,
+        .events  = EPOLLIN | EPOLLRDHUP
+    };
+    socklen_t len = sizeof(*cred);
+    size_t i, states = sizeof(States) / sizeof(States[0]);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, cred, &len) < 0) {
+        warn("failed to identify inhibitor");
+        return false;
+    }
+
+    if (inhibit_count(cred->uid) >= LEASES_PER_UID) {
+        warnx("uid %d already holds %d leases, rejecting pid %d",
+              (int)cred->uid, LEASES_PER_UID, (int)cred->pid);
+        return false;
+    }
+
+    for (i = 0; i < states; ++i) {
+        if (epoll_ctl(States[i].epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            warn("failed to add inhibitor to epoll");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void inhibit_acquire(void)
+{
+    struct ucred cred;
+    size_t i, states = sizeof(States) / sizeof(States[0]);
+
+    while (true) {
+        struct lease_t *lease;
+        int fd = accept4(inhibit_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                break;
+            warn("failed to accept inhibitor");
+            break;
+        }
+
+        if (!inhibit_accept(fd, &cred)) {
+            close(fd);
+            continue;
+        }
+
+        lease = malloc(sizeof(struct lease_t));
+        lease->fd = fd;
+        lease->pid = cred.pid;
+        lease->uid = cred.uid;
+        lease->next = leases;
+
+        /* first lease, stop dimming */
+        if (!leases) {
+            backlight_undim(&b);
+            for (i = 0; i < states; ++i)
+                timer_disarm(&States[i]);
+        }
+        leases = lease;
+
+        printf("Dimming inhibited by pid %d\n", (int)lease->pid);
+        fflush(stdout);
+    }
+}
+
+static struct lease_t *inhibit_find(int fd)
+{
+    struct lease_t *lease;
+
+    for (lease = leases; lease; lease = lease->next) {
+        if (lease->fd == fd)
+            return lease;
+    }
+    return NULL;
+}
+
+static void inhibit_release(struct lease_t *lease)
+{
+    struct lease_t **p;
+
+    for (p = &leases; *p != lease; p = &(*p)->next)
+        ;
+    *p = lease->next;
+
+    printf("Inhibitor pid %d released\n", (int)lease->pid);
+    fflush(stdout);
+
+    close(lease->fd);
+    free(lease);
+
+    if (!leases)
+        timer_set(state);
+}
+
+/* clients have nothing to say, anything read is discarded until they
+ * hang up */
+static void inhibit_event(struct lease_t *lease, uint32_t events)
+{
+    char buf[256];
+    ssize_t n;
+
+    if (!(events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))) {
+        while ((n = read(lease->fd, buf, sizeof(buf))) > 0)
+            ;
+        if (n < 0 && errno == EAGAIN)
+            return;
+    }
+
+    inhibit_release(lease);
+}
+// }}}
+
+// {{{1 ENERGY
+/* Integrate the current brightness since the last call. Must be called
+ * before anything that changes the brightness or dim state. */
+static void energy_account(void)
+{
+    struct timespec now;
+    double dt, level;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    dt = (now.tv_sec - energy.last.tv_sec) + (now.tv_nsec - energy.last.tv_nsec) / 1e9;
+    energy.last = now;
+
+    if (!state)
+        return;
+
+    level = parked ? 0 : backlight_cached(&b);
+    energy.level_time += level * dt;
+    if (dimmed && state->brightness > level)
+        energy.saved_time += (state->brightness - level) * dt;
+}
+
+/* sample only on battery, on AC power_now is the charge rate */
+static void energy_arm(bool on)
+{
+    struct itimerspec spec = {
+        .it_value.tv_sec    = on ? ENERGY_SAMPLE_SEC : 0,
+        .it_interval.tv_sec = on ? ENERGY_SAMPLE_SEC : 0
+    };
+
+    if (energy_fd < 0)
+        return;
+
+    if (timerfd_settime(energy_fd, 0, &spec, NULL) < 0)
+        err(EXIT_FAILURE, "failed to set energy timer");
+}
+
+static double energy_read_power(void)
+{
+    double watts = -1;
+    const char *power, *current, *voltage;
+    struct udev_device *dev = udev_device_new_from_syspath(udev, battery);
+
+    if (!dev)
+        return -1;
+
+    power = udev_device_get_sysattr_value(dev, "power_now");
+    current = udev_device_get_sysattr_value(dev, "current_now");
+    voltage = udev_device_get_sysattr_value(dev, "voltage_now");
+
+    /* power_now is in uW, current_now in uA and voltage_now in uV */
+    if (power)
+        watts = atof(power) / 1e6;
+    else if (current && voltage)
+        watts = atof(current) * atof(voltage) / 1e12;
+
+    udev_device_unref(dev);
+    return watts;
+}
+
+static void energy_sample(void)
+{
+    double level, watts;
+    size_t bin;
+
+    timer_drain(energy_fd);
+    energy_account();
+
+    watts = energy_read_power();
+    if (watts <= 0)
+        return;
+
+    level = parked ? 0 : backlight_cached(&b);
+    energy.n++;
+    energy.sx += level;
+    energy.sy += watts;
+    energy.sxx += level * level;
+    energy.sxy += level * watts;
+
+    bin = (size_t)(level / 100.0 * ENERGY_BINS);
+    if (bin >= ENERGY_BINS)
+        bin = ENERGY_BINS - 1;
+    energy.bins[bin].n++;
+    energy.bins[bin].power += watts;
+}
+
+static void energy_init(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &energy.last);
+
+    if (!battery)
+        return;
+
+    printf("Sampling power draw from %s\n", battery);
+    fflush(stdout);
+
+    energy_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (energy_fd < 0)
+        err(EXIT_FAILURE, "failed to create timer");
+
+    register_epoll(energy_fd, AC_OFF);
+    energy_arm(power_mode == AC_OFF && !parked);
+}
+
+static void energy_dump(void)
+{
+    double slope = 0, denom;
+    size_t i;
+
+    energy_account();
+
+    /* without samples at more than one brightness there's no slope */
+    denom = energy.n * energy.sxx - energy.sx * energy.sx;
+    if (denom > 1e-9)
+        slope = (energy.n * energy.sxy - energy.sx * energy.sy) / denom;
+
+    printf("energy: %lu samples, %.4f W per %%, backlight %.3f Wh, dimming saved %.3f Wh\n",
+           energy.n, slope, slope * energy.level_time / 3600.0,
+           slope * energy.saved_time / 3600.0);
+
+    for (i = 0; i < ENERGY_BINS; ++i) {
+        if (!energy.bins[i].n)
+            continue;
+        printf("  %3zu-%3zu%%: %.2f W (%lu samples)\n",
+               i * 100 / ENERGY_BINS, (i + 1) * 100 / ENERGY_BINS,
+               energy.bins[i].power / energy.bins[i].n, energy.bins[i].n);
+    }
+}
+// }}}
+
+// {{{1 STATS
+static void stats_init(void)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        err(EXIT_FAILURE, "failed to block signals");
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0)
+        err(EXIT_FAILURE, "failed to create signalfd");
+
+    register_epoll(signal_fd, AC_BOTH);
+}
+
+static void stats_dump(void)
+{
+    struct signalfd_siginfo si;
+
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si))
+        ;
+
+    printf("wakeups: %lu, dims: %lu, irq samples: %lu\n",
+           stats.wakeups, stats.dims, stats.irq_samples);
+    energy_dump();
+    fflush(stdout);
 }
 // }}}
 
 static int loop()
 {
-    bool dimmed = false;
     struct epoll_event events[64];
 
     while (true) {
@@ -416,27 +1172,59 @@ static int loop()
             err(EXIT_FAILURE, "epoll_wait failed");
         }
 
+        ++stats.wakeups;
+
         for (i = 0; i < n; ++i) {
             struct epoll_event *evt = &events[i];
-
-            if (evt->events & EPOLLERR || evt->events & EPOLLHUP) {
-                close(evt->data.fd);
+            struct lease_t *lease;
+
+            /* sysfs_notify signals EPOLLERR too, check this first */
+            if (evt->data.fd == backlight_fd) {
+                backlight_changed();
+            } else if (evt->events & EPOLLERR || evt->events & EPOLLHUP) {
+                /* only ever close what we track */
+                if ((lease = inhibit_find(evt->data.fd))) {
+                    inhibit_release(lease);
+                } else if (evt->data.fd == lid_fd) {
+                    lid_close();
+                    park_update();
+                } else if (!unregister_fd(evt->data.fd)) {
+                    warnx("unexpected hangup on fd %d", evt->data.fd);
+                }
             } else if (evt->data.fd == input_mon_fd) {
                 udev_monitor_input();
+            } else if (evt->data.fd == backlight_mon_fd) {
+                udev_monitor_backlight();
+            } else if (evt->data.fd == lid_fd) {
+                lid_event();
             } else if (evt->data.fd == power_mon_fd) {
                 bool save = state->dim == 0;
                 udev_monitor_power(save);
+            } else if (evt->data.fd == inhibit_fd) {
+                inhibit_acquire();
+            } else if (evt->data.fd == signal_fd) {
+                stats_dump();
+            } else if (evt->data.fd == energy_fd) {
+                energy_sample();
             } else if (evt->data.fd == state->timer_fd) {
-                dimmed = true;
-                backlight_dim(&b, state->dim);
+                timer_drain(state->timer_fd);
+
+                /* could have parked or been inhibited earlier in this batch */
+                if (parked || leases)
+                    continue;
+
+                if (backend == IDLE_IRQ && irq_activity()) {
+                    timer_set(state);
+                } else if (!dimmed) {
+                    ++stats.dims;
+                    backlight_dim(&b, state->dim);
+                }
+            } else if ((lease = inhibit_find(evt->data.fd))) {
+                inhibit_event(lease, evt->events);
             } else {
                 /* We don't want to undim or reset the time each time we
                  * get activity. Creates a massive cpu load */
-                if (dimmed) {
-                    dimmed = false;
-                    backlight_set(&b, state->brightness);
-                }
-
+                backlight_undim(&b);
                 timer_set(state);
             }
         }
@@ -453,7 +1241,10 @@ static void __attribute__((__noreturn__)) usage(FILE *out)
         " -v, --version          display version\n"
         " -D, --dimmer           dim the screen when inactivity detected\n"
         " -d, --dim=VALUE        the amount to dim the screen by\n"
-        " -t, --timeout=VALUE    set the timeout till the screen is dimmed\n", out);
+        " -t, --timeout=VALUE    set the timeout till the screen is dimmed\n"
+        " -b, --backend=NAME     detect idle with evdev (default) or irq\n"
+        " -I, --irq=NAME         an interrupt to watch with the irq backend\n"
+        " -s, --socket=PATH      where to listen for inhibitors\n", out);
 
     exit(out == stderr ? EXIT_FAILURE : EXIT_SUCCESS);
 }
@@ -466,11 +1257,14 @@ int main(int argc, char *argv[])
         { "dimmer",  no_argument,       0, 'D' },
         { "dim",     required_argument, 0, 'd' },
         { "timeout", required_argument, 0, 't' },
+        { "backend", required_argument, 0, 'b' },
+        { "irq",     required_argument, 0, 'I' },
+        { "socket",  required_argument, 0, 's' },
         { 0, 0, 0, 0 }
     };
 
     while (true) {
-        int opt = getopt_long(argc, argv, "hvDd:t:", opts, NULL);
+        int opt = getopt_long(argc, argv, "hvDd:t:b:I:s:", opts, NULL);
         if (opt == -1)
             break;
 
@@ -490,6 +1284,22 @@ int main(int argc, char *argv[])
         case 't':
             States[AC_OFF].timeout.tv_sec = atoi(optarg);
             break;
+        case 'b':
+            if (strcmp("evdev", optarg) == 0)
+                backend = IDLE_EVDEV;
+            else if (strcmp("irq", optarg) == 0)
+                backend = IDLE_IRQ;
+            else
+                errx(EXIT_FAILURE, "unknown backend: %s", optarg);
+            break;
+        case 'I':
+            if (irq_len == IRQ_MAX)
+                errx(EXIT_FAILURE, "too many interrupts, at most %d", IRQ_MAX);
+            irq_names[irq_len++] = optarg;
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
         default:
             usage(stderr);
         }
@@ -500,8 +1310,12 @@ int main(int argc, char *argv[])
         errx(EXIT_FAILURE, "failed to get backlight info");
 
     epoll_init();
-    udev_init();
+    stats_init();
+    backlight_init_watch();
     timer_init();
+    udev_init();
+    energy_init();
+    inhibit_init();
 
     return loop();
 }
@@ -0,0 +1,207 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Simon Gomizelj, 2013
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "backlight.h"
+#include "test.h"
+
+#define SLOW_USEC 20000L
+#define EVEN_USEC 2000L
+
+static char tmpl[] = "/tmp/lightd-test-XXXXXX";
+static char *tree;
+
+static void write_file(const char *path, long value)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        err(EXIT_FAILURE, "failed to create %s", path);
+    fprintf(fp, "%ld\n", value);
+    fclose(fp);
+}
+
+static long read_file(const char *path)
+{
+    long value = -1;
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        err(EXIT_FAILURE, "failed to open %s", path);
+    if (fscanf(fp, "%ld", &value) != 1)
+        value = -1;
+    fclose(fp);
+    return value;
+}
+
+/* a fresh fake /sys/class/backlight and cache for every case */
+static void fake_tree(const char *name)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, PATH_MAX, "%s/%s", tree, name);
+    if (mkdir(path, 0755) < 0)
+        err(EXIT_FAILURE, "failed to create %s", path);
+
+    setenv("BACKLIGHT_ROOT", path, 1);
+    snprintf(path, PATH_MAX, "%s/%s.cache", tree, name);
+    setenv("BACKLIGHT_CACHE", path, 1);
+}
+
+static void fake_device(const char *name, long max, long brightness)
+{
+    char path[PATH_MAX];
+    const char *root = getenv("BACKLIGHT_ROOT");
+
+    snprintf(path, PATH_MAX, "%s/%s", root, name);
+    if (mkdir(path, 0755) < 0)
+        err(EXIT_FAILURE, "failed to create %s", path);
+
+    snprintf(path, PATH_MAX, "%s/%s/max_brightness", root, name);
+    write_file(path, max);
+    snprintf(path, PATH_MAX, "%s/%s/brightness", root, name);
+    write_file(path, brightness);
+}
+
+/* make every write to a device named slow* take SLOW_USEC */
+static void slow_hook(const char *path)
+{
+    struct timespec pause = { .tv_nsec = SLOW_USEC * 1000L };
+
+    if (strstr(path, "/slow"))
+        nanosleep(&pause, NULL);
+}
+
+/* every write takes EVEN_USEC, which drowns out scheduling noise */
+static void even_hook(const char *path)
+{
+    struct timespec pause = { .tv_nsec = EVEN_USEC * 1000L };
+
+    (void)path;
+    nanosleep(&pause, NULL);
+}
+
+static void test_uncalibrated(void)
+{
+    struct backlight_t b;
+
+    fake_tree("uncalibrated");
+    fake_device("acpi_video0", 15, 7);
+    fake_device("intel_backlight", 4882, 2000);
+
+    check(backlight_find_best(&b) == 0);
+    check(strcmp(b.name, "intel_backlight") == 0);
+    check(b.levels == 0);
+    check(b.level == 2000);
+}
+
+static void test_levels(void)
+{
+    struct backlight_t b;
+    char path[PATH_MAX];
+
+    fake_tree("levels");
+    fake_device("acpi_video0", 15, 7);
+    fake_device("intel_backlight", 4882, 2000);
+
+    check(backlight_calibrate_all() == 0);
+    check(backlight_find_best(&b) == 0);
+    check(strcmp(b.name, "intel_backlight") == 0);
+    check(b.levels == 65);
+
+    /* calibration puts the brightness back */
+    snprintf(path, PATH_MAX, "%s/acpi_video0/brightness", getenv("BACKLIGHT_ROOT"));
+    check(read_file(path) == 7);
+
+    check(backlight_init(&b, "acpi_video0") == 0);
+    check(b.levels == 16);
+}
+
+/* both saturate the probes and neither is clearly faster, so latency
+ * noise mustn't decide */
+static void test_saturated(void)
+{
+    struct backlight_t b;
+
+    fake_tree("saturated");
+    fake_device("radeon_bl0", 255, 100);
+    fake_device("intel_backlight", 4882, 2000);
+
+    backlight_write_hook = even_hook;
+    check(backlight_calibrate_all() == 0);
+    backlight_write_hook = NULL;
+
+    check(backlight_init(&b, "radeon_bl0") == 0);
+    check(b.levels == 65 && b.latency >= EVEN_USEC);
+
+    check(backlight_find_best(&b) == 0);
+    check(strcmp(b.name, "intel_backlight") == 0);
+}
+
+static void test_delay(void)
+{
+    struct backlight_t b;
+
+    fake_tree("delay");
+    fake_device("fast", 255, 100);
+    fake_device("slow", 4882, 2000);
+
+    backlight_write_hook = slow_hook;
+    check(backlight_calibrate_all() == 0);
+    backlight_write_hook = NULL;
+
+    check(backlight_init(&b, "slow") == 0);
+    check(b.latency >= SLOW_USEC);
+
+    check(backlight_find_best(&b) == 0);
+    check(strcmp(b.name, "fast") == 0);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st, (void)flag, (void)ftw;
+    return remove(path);
+}
+
+int main(void)
+{
+    tree = mkdtemp(tmpl);
+    if (!tree)
+        err(EXIT_FAILURE, "failed to create temporary directory");
+
+    test_uncalibrated();
+    test_levels();
+    test_saturated();
+    test_delay();
+
+    if (failures)
+        errx(EXIT_FAILURE, "%d checks failed, tree left in %s", failures, tree);
+
+    nftw(tree, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    printf("backlight: all checks passed\n");
+    return 0;
+}
+
+// vim: et:sts=4:sw=4:cino=(0
@@ -0,0 +1,100 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Simon Gomizelj, 2013
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "irq.h"
+#include "test.h"
+
+/* captured from a four core laptop, trimmed */
+static const char sample[] =
+    "            CPU0       CPU1       CPU2       CPU3       \n"
+    "   0:         12          0          0          0   IO-APIC    2-edge      timer\n"
+    "   1:       4211        512       1200         33  IR-IO-APIC    1-edge      i8042\n"
+    "   8:          0          0          0          1  IR-IO-APIC    8-edge      rtc0\n"
+    "  12:      91234          0       8800          0  IR-IO-APIC   12-edge      i8042\n"
+    "  16:          0          0         71          0  IR-IO-APIC   16-fasteoi   i801_smbus, ehci_hcd:usb1\n"
+    "  27:        300        200        100          0  IR-PCI-MSI 327680-edge      xhci_hcd\n"
+    "  51:         10         20          0         40  IR-IO-APIC   51-fasteoi   i2c_designware.1, idma64.1\n"
+    "  52:          0          0          0          0  PCI-MSI 512000-edge      ahci[0000:00:17.0]\n"
+    " NMI:          3          2          1          0   Non-maskable interrupts\n"
+    " LOC:    1234567    2345678    3456789    4567890   Local timer interrupts\n"
+    " ERR:          0\n"
+    " MIS:          0\n";
+
+static char path[] = "/tmp/lightd-interrupts-XXXXXX";
+
+static unsigned long long sample_for(const char *const names[], size_t len)
+{
+    unsigned long long total = 0;
+
+    if (irq_sample(path, names, len, &total) < 0)
+        err(EXIT_FAILURE, "failed to sample %s", path);
+    return total;
+}
+
+#define SAMPLE(...) sample_for((const char *const[]){ __VA_ARGS__ }, \
+    sizeof((const char *const[]){ __VA_ARGS__ }) / sizeof(const char *))
+
+int main(void)
+{
+    unsigned long long total;
+    int fd = mkstemp(path);
+
+    if (fd < 0)
+        err(EXIT_FAILURE, "failed to create %s", path);
+    if (write(fd, sample, sizeof(sample) - 1) < 0)
+        err(EXIT_FAILURE, "failed to write %s", path);
+    close(fd);
+
+    /* summed over every cpu and every line with that action */
+    check(SAMPLE("i8042") == 4211 + 512 + 1200 + 33 + 91234 + 8800);
+
+    /* chip names don't confuse the column parsing */
+    check(SAMPLE("xhci_hcd") == 600);
+    check(SAMPLE("i2c_designware.1") == 70);
+    check(SAMPLE("idma64.1") == 70);
+
+    /* shared lines only count once */
+    check(SAMPLE("i801_smbus", "ehci_hcd:usb1") == 71);
+    check(SAMPLE("i8042", "xhci_hcd") == 105990 + 600);
+
+    /* names must match a whole field, not a substring */
+    check(SAMPLE("usb1") == 0);
+    check(SAMPLE("hcd") == 0);
+    check(SAMPLE("i804") == 0);
+
+    /* the per-cpu summaries aren't irqs */
+    check(SAMPLE("timer") == 12);
+    check(SAMPLE("Non-maskable") == 0);
+    check(SAMPLE("interrupts") == 0);
+
+    check(irq_sample("/nonexistent", NULL, 0, &total) < 0);
+
+    unlink(path);
+    if (failures)
+        errx(EXIT_FAILURE, "%d checks failed", failures);
+
+    printf("irq: all checks passed\n");
+    return 0;
+}
+
+// vim: et:sts=4:sw=4:cino=(0